@@ -1,6 +1,7 @@
 #include "application.h"
 #include "ui_main_window.h"
 #include "wave_processor.h"
+#include "wave_sandbox.h"
 #include "wavetable.h"
 #include <Qsci/qscilexermatlab.h>
 #include <Q3DSurface>
@@ -16,6 +17,7 @@
 #include <QTimer>
 #include <QJsonDocument>
 #include <QJsonObject>
+#include <QCryptographicHash>
 #include <QDebug>
 #include <functional>
 
@@ -25,7 +27,9 @@ class SliderAction;
 
 struct Application::Impl {
     std::unique_ptr<WaveProcessor> waveProc_;
+    std::unique_ptr<WaveSandbox> waveSandbox_;
     Wavetable_s waveTable_;
+    QByteArray waveTableHash_; // source hash of the current table
     Q3DSurface *wavePlot3D_ = nullptr;
 
     ///
@@ -35,6 +39,9 @@ struct Application::Impl {
 
     SliderAction *actionSetTableSize_ = nullptr;
     SliderAction *actionSetNumTables_ = nullptr;
+    QAction *actionSandboxed_ = nullptr;
+    SliderAction *actionSetTimeLimit_ = nullptr;
+    SliderAction *actionSetMemoryLimit_ = nullptr;
 
     QString lastFilename;
 
@@ -45,10 +52,18 @@ struct Application::Impl {
         minNumTables = 8,
         maxNumTables = 256,
         defNumTables = 64,
+        minTimeLimit = 1,
+        maxTimeLimit = 300,
+        defTimeLimit = 10,
+        minMemoryLimit = 1,
+        maxMemoryLimit = 64,
+        defMemoryLimit = 4,
     };
 
     ///
     void runCode();
+    void onCodeResult(Wavetable_s wt, const std::string &errmsg, const QByteArray &hash);
+    QByteArray sourceHash() const;
     void onWavetableUpdated();
     void showError(const QString &msg);
 
@@ -116,13 +131,9 @@ bool Application::init()
     impl_.reset(impl);
 
     ///
-    WaveProcessor *waveProc = new WaveProcessor;
-    impl->waveProc_.reset(waveProc);
-
-    if (!*waveProc) {
-        QMessageBox::critical(nullptr, tr("Error"), tr("Could not initialize the Octave interpreter."));
-        return false;
-    }
+    // failures of the evaluation process are reported on evaluation
+    WaveSandbox *waveSandbox = new WaveSandbox(Impl::defMemoryLimit * 1024);
+    impl->waveSandbox_.reset(waveSandbox);
 
     ///
     QMainWindow *window = new QMainWindow;
@@ -167,6 +178,30 @@ bool Application::init()
     actionSetNumTables->setTextFunction([](int v) { return QString("Table count: %0").arg(v); });
     settingsMenu->addAction(actionSetNumTables);
 
+    settingsMenu->addSeparator();
+
+    QAction *actionSandboxed = new QAction(tr("Evaluate in a separate process"), window);
+    impl->actionSandboxed_ = actionSandboxed;
+    actionSandboxed->setCheckable(true);
+    actionSandboxed->setChecked(true);
+    settingsMenu->addAction(actionSandboxed);
+
+    SliderAction *actionSetTimeLimit = new SliderAction(window);
+    impl->actionSetTimeLimit_ = actionSetTimeLimit;
+    actionSetTimeLimit->slider()->setMinimumWidth(200);
+    actionSetTimeLimit->slider()->setRange(Impl::minTimeLimit, Impl::maxTimeLimit);
+    actionSetTimeLimit->slider()->setValue(Impl::defTimeLimit);
+    actionSetTimeLimit->setTextFunction([](int v) { return QString("Time limit: %0 s").arg(v); });
+    settingsMenu->addAction(actionSetTimeLimit);
+
+    SliderAction *actionSetMemoryLimit = new SliderAction(window);
+    impl->actionSetMemoryLimit_ = actionSetMemoryLimit;
+    actionSetMemoryLimit->slider()->setMinimumWidth(200);
+    actionSetMemoryLimit->slider()->setRange(Impl::minMemoryLimit, Impl::maxMemoryLimit);
+    actionSetMemoryLimit->slider()->setValue(Impl::defMemoryLimit);
+    actionSetMemoryLimit->setTextFunction([](int v) { return QString("Memory limit: %0 GB").arg(v); });
+    settingsMenu->addAction(actionSetMemoryLimit);
+
     ///
     Q3DSurface *wavePlot3D = new Q3DSurface;
     impl->wavePlot3D_ = wavePlot3D;
@@ -236,6 +271,10 @@ bool Application::init()
             this, [impl, runCodeTimer](int v) { runCodeTimer->start(); });
     connect(actionSetNumTables->slider(), &QSlider::valueChanged,
             this, [impl, runCodeTimer](int v) { runCodeTimer->start(); });
+    connect(actionSandboxed, &QAction::toggled,
+            this, [runCodeTimer]() { runCodeTimer->start(); });
+    connect(actionSetMemoryLimit->slider(), &QSlider::valueChanged,
+            this, [runCodeTimer]() { runCodeTimer->start(); });
 
     connect(ui->actionOpen, &QAction::triggered, this, [impl]() { impl->onOpen(); });
     connect(ui->actionSave, &QAction::triggered, this, [impl]() { impl->onSave(); });
@@ -252,21 +291,57 @@ void Application::Impl::runCode()
     const unsigned count = actionSetNumTables_->slider()->value();
     const unsigned frames = 1 << actionSetTableSize_->slider()->value();
     const std::string wavecode = ui_->txtCode->text().toStdString();
+    const QByteArray hash = sourceHash();
+
+    if (actionSandboxed_->isChecked()) {
+        // kills the evaluation in progress, if any
+        const std::chrono::seconds timeLimit(actionSetTimeLimit_->slider()->value());
+        waveSandbox_->setMemoryLimit(actionSetMemoryLimit_->slider()->value() * 1024);
+        waveSandbox_->process(
+            wavecode, count, frames, timeLimit,
+            [this, hash](Wavetable *wt, const std::string &errmsg) { onCodeResult(Wavetable_s(wt), errmsg, hash); });
+        return;
+    }
 
+    waveSandbox_->cancel();
+
+    // the in-process interpreter is started on first use
     std::string errmsg;
-    Wavetable_s wt(waveProc_->process(wavecode, count, frames, &errmsg));
+    Wavetable_s wt;
+    if (!waveProc_)
+        waveProc_.reset(new WaveProcessor);
+    if (!*waveProc_)
+        errmsg = "Could not initialize the Octave interpreter.";
+    else
+        wt.reset(waveProc_->process(wavecode, count, frames, &errmsg));
 
-    QPlainTextEdit *txtOutput = ui_->txtOutput;
+    onCodeResult(wt, errmsg, hash);
+}
+
+void Application::Impl::onCodeResult(Wavetable_s wt, const std::string &errmsg, const QByteArray &hash)
+{
     if (!wt) {
         showError(QString::fromStdString(errmsg));
     }
     else {
         showError(QString());
         waveTable_ = wt;
+        waveTableHash_ = hash;
         onWavetableUpdated();
     }
 }
 
+QByteArray Application::Impl::sourceHash() const
+{
+    QCryptographicHash hash(QCryptographicHash::Sha256);
+    hash.addData(ui_->txtCode->text().toUtf8());
+    hash.addData(QByteArray(1, '\0'));
+    hash.addData(QByteArray::number(actionSetNumTables_->slider()->value()));
+    hash.addData(QByteArray(1, '\0'));
+    hash.addData(QByteArray::number(actionSetTableSize_->slider()->value()));
+    return hash.result().toHex();
+}
+
 void Application::Impl::onWavetableUpdated()
 {
     const Wavetable &wt = *waveTable_;
@@ -345,7 +420,27 @@ void Application::Impl::onOpen()
     actionSetTableSize_->slider()->setValue(doc["table-size-log2"].toInt());
     ui_->txtCode->setText(doc["source"].toString());
 
-    runCodeTimer_->start();
+    // display the rendered table if it's up to date, instead of evaluating
+    Wavetable_s wt;
+    QJsonObject cache = doc["render-cache"].toObject();
+    const QByteArray hash = sourceHash();
+    if (cache["hash"].toString().toLatin1() == hash)
+        wt.reset(Wavetables::loadFromCompressedData(
+                     QByteArray::fromBase64(cache["data"].toString().toLatin1()),
+                     maxNumTables, 1u << maxTableSizeLog2));
+
+    const unsigned count = actionSetNumTables_->slider()->value();
+    const unsigned frames = 1 << actionSetTableSize_->slider()->value();
+    if (wt && wt->count == count && wt->frames == frames) {
+        runCodeTimer_->stop();
+        waveSandbox_->cancel();
+        showError(QString());
+        waveTable_ = wt;
+        waveTableHash_ = hash;
+        onWavetableUpdated();
+    }
+    else
+        runCodeTimer_->start();
 
     lastFilename = filename;
 }
@@ -375,10 +470,18 @@ void Application::Impl::doSave(const QString &filename)
 {
     QJsonObject obj;
     obj["file-type"] = "Wavetable source";
-    obj["file-version"] = "1";
+    obj["file-version"] = "2";
     obj["source"] = ui_->txtCode->text();
     obj["table-count"] = qint64(actionSetNumTables_->slider()->value());
     obj["table-size-log2"] = qint64(actionSetTableSize_->slider()->value());
+
+    const QByteArray hash = sourceHash();
+    if (waveTable_ && waveTableHash_ == hash) {
+        QJsonObject cache;
+        cache["hash"] = QString::fromLatin1(hash);
+        cache["data"] = QString::fromLatin1(Wavetables::saveToCompressedData(*waveTable_).toBase64());
+        obj["render-cache"] = cache;
+    }
     QJsonDocument doc(obj);
 
     QFile file(filename);
@@ -1,7 +1,12 @@
 #include "application.h"
+#include "wave_sandbox.h"
+#include <cstring>
 
 int main(int argc, char *argv[])
 {
+    if (argc > 1 && !std::strcmp(argv[1], WaveSandbox::workerArgument))
+        return WaveSandbox::execWorker(argc, argv);
+
     Application app(argc, argv);
     if (!app.init())
         return 1;
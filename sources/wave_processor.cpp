@@ -2,6 +2,7 @@
 #include "wavetable.h"
 #include <octave/interpreter.h>
 #include <octave/error.h>
+#include <new>
 
 struct WaveProcessor::Impl {
     octave::interpreter interp_;
@@ -31,19 +32,25 @@ WaveProcessor::operator bool() const noexcept
 }
 
 Wavetable *WaveProcessor::process(const std::string &wavecode, unsigned count, unsigned frames, std::string *errmsg)
+{
+    if (count < 1 || frames < 1)
+        return nullptr;
+
+    Wavetable_u wt(Wavetables::allocate(count, frames));
+    if (!process(wavecode, count, frames, wt->data, errmsg))
+        return nullptr;
+
+    return wt.release();
+}
+
+bool WaveProcessor::process(const std::string &wavecode, unsigned count, unsigned frames, float *data, std::string *errmsg)
 {
     Impl &impl = *impl_;
-    Wavetable_u wt;
 
     if (count < 1 || frames < 1)
-        return nullptr;
+        return false;
 
     try {
-        wt.reset(new Wavetable);
-        wt->count = count;
-        wt->frames = frames;
-        wt->data.reset(new float[count * frames]);
-
         octave::interpreter &interp = impl.interp_;
         octave::symbol_table &symtab = interp.get_symbol_table();
 
@@ -65,8 +72,7 @@ Wavetable *WaveProcessor::process(const std::string &wavecode, unsigned count, u
             if (wave.is_undefined()) {
                 if (errmsg)
                     *errmsg = "Result variable 'wave' is not defined.";
-                wt.reset();
-                break;
+                return false;
             }
 
             Matrix mat;
@@ -79,20 +85,24 @@ Wavetable *WaveProcessor::process(const std::string &wavecode, unsigned count, u
             if (!valid_mat) {
                 if (errmsg)
                     *errmsg = "Result must be a column vector of size " + std::to_string(frames) + ".";
-                wt.reset();
-                break;
+                return false;
             }
 
-            float *data = &wt->data[nth * frames];
+            float *subtable = &data[nth * frames];
             for (unsigned i = 0; i < frames; ++i)
-                data[i] = mat(i);
+                subtable[i] = mat(i);
         }
     }
     catch (octave::execution_exception &ex) {
         if (errmsg)
             *errmsg = last_error_message();
-        wt.reset();
+        return false;
+    }
+    catch (std::bad_alloc &ex) {
+        if (errmsg)
+            *errmsg = "The program has run out of memory.";
+        return false;
     }
 
-    return wt.release();
+    return true;
 }
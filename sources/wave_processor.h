@@ -1,5 +1,6 @@
 #pragma once
 #include <memory>
+#include <string>
 struct Wavetable;
 
 class WaveProcessor {
@@ -10,6 +11,7 @@ public:
     explicit operator bool() const noexcept;
 
     Wavetable *process(const std::string &wavecode, unsigned count, unsigned frames, std::string *errmsg);
+    bool process(const std::string &wavecode, unsigned count, unsigned frames, float *data, std::string *errmsg);
 
 private:
     struct Impl;
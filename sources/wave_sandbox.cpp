@@ -0,0 +1,416 @@
+#include "wave_sandbox.h"
+#include "wave_processor.h"
+#include "wavetable.h"
+#include <QCoreApplication>
+#include <QProcess>
+#include <QSharedMemory>
+#include <QTimer>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QFile>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <cerrno>
+#if defined(Q_OS_UNIX)
+#include <sys/resource.h>
+#include <unistd.h>
+#include <fcntl.h>
+#endif
+#if defined(Q_OS_LINUX)
+#include <sys/prctl.h>
+#include <signal.h>
+#endif
+
+enum : unsigned {
+    startupTimeLimit = 30000, // milliseconds to start the interpreter
+    maxSegmentAttempts = 64, // keys to try when a segment is left over
+};
+
+const char WaveSandbox::workerArgument[] = "--wave-worker";
+
+struct WaveSandbox::Impl {
+    struct Worker {
+        QProcess *process = new QProcess;
+        bool ready = false;
+        ~Worker();
+    };
+    typedef std::unique_ptr<Worker> Worker_u;
+
+    struct Request {
+        QByteArray message;
+        std::shared_ptr<QSharedMemory> shm;
+        unsigned count = 0;
+        unsigned frames = 0;
+        std::chrono::milliseconds timeLimit;
+        ResultFunction result;
+        bool sent = false;
+    };
+    typedef std::unique_ptr<Request> Request_u;
+
+    QTimer deadline_;
+    Request_u request_;
+    Worker_u active_;
+    Worker_u spare_; // started in advance, takes over when the active one is killed
+    unsigned segmentCounter_ = 0;
+    unsigned memoryLimit_ = 0; // megabytes of data of the child
+
+    Worker_u spawn();
+    void restart();
+    void sendRequest();
+    void finish(Wavetable *wt, const std::string &errmsg);
+    void cancel();
+
+    void onReadyRead(Worker &w);
+    void onFinished(Worker &w);
+    void onDeadline();
+};
+
+WaveSandbox::WaveSandbox(unsigned memoryLimit)
+{
+    Impl *impl = new Impl;
+    impl_.reset(impl);
+    impl->memoryLimit_ = memoryLimit;
+
+    impl->deadline_.setSingleShot(true);
+    QObject::connect(&impl->deadline_, &QTimer::timeout,
+                     [impl]() { impl->onDeadline(); });
+
+    impl->active_ = impl->spawn();
+    impl->spare_ = impl->spawn();
+}
+
+WaveSandbox::~WaveSandbox()
+{
+}
+
+WaveSandbox::operator bool() const noexcept
+{
+    Impl &impl = *impl_;
+    return impl.active_->process->state() != QProcess::NotRunning;
+}
+
+void WaveSandbox::process(const std::string &wavecode, unsigned count, unsigned frames, std::chrono::milliseconds timeLimit, ResultFunction result)
+{
+    Impl &impl = *impl_;
+
+    impl.cancel();
+
+    if (count < 1 || frames < 1) {
+        result(nullptr, "The table dimensions are invalid.");
+        return;
+    }
+
+    // the worker may have died while idle
+    if (impl.active_->process->state() == QProcess::NotRunning)
+        impl.restart();
+
+    // the child renders directly into the memory of the resulting table
+    QString key;
+    std::shared_ptr<QSharedMemory> shm(new QSharedMemory);
+    bool created = false;
+    for (unsigned i = 0; !created && i < maxSegmentAttempts; ++i) {
+        // skip the segments left over by a crashed session with the same pid
+        key = QString("%0-%1-%2").arg(PROJECT_NAME)
+            .arg(QCoreApplication::applicationPid()).arg(impl.segmentCounter_++);
+        shm->setKey(key);
+        created = shm->create(count * frames * sizeof(float));
+        if (!created && shm->error() != QSharedMemory::AlreadyExists)
+            break;
+    }
+    if (!created) {
+        result(nullptr, "Could not allocate the shared memory: " + shm->errorString().toStdString());
+        return;
+    }
+
+    QJsonObject message;
+    message["key"] = key;
+    message["table-count"] = qint64(count);
+    message["table-size"] = qint64(frames);
+    message["source"] = QString::fromStdString(wavecode);
+
+    Impl::Request *request = new Impl::Request;
+    impl.request_.reset(request);
+    request->message = QJsonDocument(message).toJson(QJsonDocument::Compact) + '\n';
+    request->shm = shm;
+    request->count = count;
+    request->frames = frames;
+    request->timeLimit = timeLimit;
+    request->result = std::move(result);
+
+    // wait for the interpreter to start, if it's not yet
+    impl.deadline_.start(std::chrono::milliseconds(startupTimeLimit));
+    impl.sendRequest();
+}
+
+void WaveSandbox::cancel()
+{
+    Impl &impl = *impl_;
+    impl.cancel();
+}
+
+void WaveSandbox::setMemoryLimit(unsigned memoryLimit)
+{
+    Impl &impl = *impl_;
+    if (impl.memoryLimit_ == memoryLimit)
+        return;
+
+    // the limit is applied by the workers at startup
+    impl.cancel();
+    impl.memoryLimit_ = memoryLimit;
+    impl.active_ = impl.spawn();
+    impl.spare_ = impl.spawn();
+}
+
+WaveSandbox::Impl::Worker::~Worker()
+{
+    // may be destroyed from inside a handler of the process
+    process->disconnect();
+    if (process->state() != QProcess::NotRunning) {
+        process->kill();
+        process->waitForFinished();
+    }
+    process->deleteLater();
+}
+
+auto WaveSandbox::Impl::spawn() -> Worker_u
+{
+    Worker_u w(new Worker);
+    Worker *wp = w.get();
+    QProcess *proc = w->process;
+    proc->setProcessChannelMode(QProcess::ForwardedErrorChannel);
+
+    QObject::connect(proc, &QProcess::readyReadStandardOutput,
+                     [this, wp]() { onReadyRead(*wp); });
+    QObject::connect(proc, QOverload<int, QProcess::ExitStatus>::of(&QProcess::finished),
+                     [this, wp]() { onFinished(*wp); });
+    QObject::connect(proc, &QProcess::errorOccurred,
+                     [this, wp](QProcess::ProcessError error) {
+                         if (error == QProcess::FailedToStart)
+                             onFinished(*wp);
+                     });
+
+    proc->start(QCoreApplication::applicationFilePath(),
+                {workerArgument, QString::number(memoryLimit_)});
+    return w;
+}
+
+void WaveSandbox::Impl::restart()
+{
+    // the spare may have died while idle
+    if (spare_->process->state() == QProcess::NotRunning)
+        spare_ = spawn();
+
+    active_ = std::move(spare_);
+    spare_ = spawn();
+}
+
+void WaveSandbox::Impl::sendRequest()
+{
+    Request *request = request_.get();
+    if (!request || request->sent || !active_->ready)
+        return;
+
+    active_->process->write(request->message);
+    request->sent = true;
+    deadline_.start(request->timeLimit);
+}
+
+void WaveSandbox::Impl::finish(Wavetable *wt, const std::string &errmsg)
+{
+    Request_u request = std::move(request_);
+    deadline_.stop();
+    request->result(wt, errmsg);
+}
+
+void WaveSandbox::Impl::cancel()
+{
+    if (!request_)
+        return;
+
+    // kill the evaluation in progress, before releasing the shared memory
+    // it's attached to, or the segment would never be removed
+    if (request_->sent)
+        restart();
+
+    request_.reset();
+    deadline_.stop();
+}
+
+void WaveSandbox::Impl::onReadyRead(Worker &w)
+{
+    QProcess &proc = *w.process;
+    while (proc.canReadLine()) {
+        QByteArray line = proc.readLine();
+
+        if (!w.ready) {
+            w.ready = line == "ready\n";
+            if (&w == active_.get())
+                sendRequest();
+            continue;
+        }
+
+        if (&w != active_.get() || !request_ || !request_->sent)
+            continue;
+
+        QJsonDocument reply = QJsonDocument::fromJson(line);
+        if (reply.isNull()) {
+            restart();
+            finish(nullptr, "The evaluation process has sent an invalid reply.");
+        }
+        else if (!reply["success"].toBool())
+            finish(nullptr, reply["error"].toString().toStdString());
+        else {
+            Wavetable_u wt(new Wavetable);
+            wt->count = request_->count;
+            wt->frames = request_->frames;
+            wt->data = static_cast<float *>(request_->shm->data());
+            wt->storage = request_->shm;
+            finish(wt.release(), std::string());
+        }
+        // the worker may be gone after this point
+        return;
+    }
+}
+
+void WaveSandbox::Impl::onFinished(Worker &w)
+{
+    if (&w != active_.get() || !request_)
+        return;
+
+    bool sent = request_->sent;
+    restart();
+
+    if (sent)
+        finish(nullptr, "The evaluation process has terminated unexpectedly.");
+    else
+        finish(nullptr, "Could not start the evaluation process. "
+               "Evaluation in a separate process can be disabled in the settings.");
+}
+
+void WaveSandbox::Impl::onDeadline()
+{
+    if (!request_)
+        return;
+
+    bool sent = request_->sent;
+    auto seconds = std::chrono::duration_cast<std::chrono::seconds>(request_->timeLimit);
+    restart();
+
+    if (sent)
+        finish(nullptr, "The program has exceeded the time limit of " +
+               std::to_string(seconds.count()) + " seconds.");
+    else
+        finish(nullptr, "Could not start the evaluation process. "
+               "Evaluation in a separate process can be disabled in the settings.");
+}
+
+///
+static bool readRequestLine(FILE *stream, std::string &line)
+{
+    line.clear();
+    char buf[4096];
+    while (std::fgets(buf, sizeof(buf), stream)) {
+        line.append(buf);
+        if (line.back() == '\n')
+            return true;
+    }
+    return !line.empty();
+}
+
+int WaveSandbox::execWorker(int argc, char *argv[])
+{
+    if (argc < 3)
+        return 1;
+
+    char *end = nullptr;
+    errno = 0;
+    unsigned long long memlimit = std::strtoull(argv[2], &end, 10);
+    if (errno != 0 || end == argv[2] || *end != '\0' || memlimit < 1) {
+        std::fprintf(stderr, "Invalid memory limit: %s\n", argv[2]);
+        return 1;
+    }
+
+#if defined(Q_OS_LINUX)
+    // do not outlive the application, even when stuck in the wave code
+    prctl(PR_SET_PDEATHSIG, SIGKILL);
+#endif
+
+    FILE *requestStream = stdin;
+    int replyFd = fileno(stdout);
+
+#if defined(Q_OS_UNIX)
+    // limit the data rather than the address space, which is reserved
+    // generously by the threads of the numeric libraries
+    rlimit lim;
+    if (getrlimit(RLIMIT_DATA, &lim) == -1) {
+        std::perror("getrlimit");
+        return 1;
+    }
+    rlim_t bytes = RLIM_INFINITY;
+    if (memlimit < RLIM_INFINITY / (1024 * 1024))
+        bytes = rlim_t(memlimit) * 1024 * 1024;
+    if (lim.rlim_max != RLIM_INFINITY && bytes > lim.rlim_max)
+        bytes = lim.rlim_max;
+    lim.rlim_cur = lim.rlim_max = bytes;
+    if (setrlimit(RLIMIT_DATA, &lim) == -1) {
+        std::perror("setrlimit");
+        return 1;
+    }
+
+    // keep the standard streams for the protocol, out of reach of the wave
+    // code and of its subprocesses, and give it /dev/null and the error instead
+    int requestFd = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 0);
+    replyFd = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 0);
+    if (requestFd == -1 || replyFd == -1)
+        return 1;
+    requestStream = fdopen(requestFd, "r");
+    if (!requestStream)
+        return 1;
+
+    int nullFd = open("/dev/null", O_RDONLY);
+    if (nullFd != -1) {
+        dup2(nullFd, STDIN_FILENO);
+        close(nullFd);
+    }
+    dup2(STDERR_FILENO, STDOUT_FILENO);
+#endif
+
+    QFile replyFile;
+    if (!replyFile.open(replyFd, QFile::WriteOnly|QFile::Unbuffered))
+        return 1;
+
+    WaveProcessor waveProc;
+    if (!waveProc)
+        return 1;
+
+    replyFile.write("ready\n");
+
+    std::string line;
+    while (readRequestLine(requestStream, line)) {
+        QJsonDocument request = QJsonDocument::fromJson(QByteArray::fromStdString(line));
+        const unsigned count = request["table-count"].toInt();
+        const unsigned frames = request["table-size"].toInt();
+        const std::string wavecode = request["source"].toString().toStdString();
+
+        QJsonObject reply;
+        QSharedMemory shm(request["key"].toString());
+        bool success = false;
+        std::string errmsg;
+        if (!shm.attach())
+            errmsg = "Could not attach the shared memory: " + shm.errorString().toStdString();
+        else if (size_t(shm.size()) < count * frames * sizeof(float))
+            errmsg = "The shared memory is too small.";
+        else
+            success = waveProc.process(wavecode, count, frames, static_cast<float *>(shm.data()), &errmsg);
+        shm.detach();
+
+        reply["success"] = success;
+        if (!success)
+            reply["error"] = QString::fromStdString(errmsg);
+
+        replyFile.write(QJsonDocument(reply).toJson(QJsonDocument::Compact) + '\n');
+    }
+
+    return 0;
+}
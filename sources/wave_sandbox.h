@@ -0,0 +1,33 @@
+#pragma once
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+struct Wavetable;
+
+// runs the wave code in a child process, restarted whenever it gets stuck
+class WaveSandbox {
+public:
+    // receives the ownership of the table, or null and the error message
+    typedef std::function<void(Wavetable *, const std::string &)> ResultFunction;
+
+    explicit WaveSandbox(unsigned memoryLimit);
+    ~WaveSandbox();
+
+    explicit operator bool() const noexcept;
+
+    // starts an evaluation, cancelling the one in progress, and reports its result asynchronously
+    void process(const std::string &wavecode, unsigned count, unsigned frames, std::chrono::milliseconds timeLimit, ResultFunction result);
+    void cancel();
+
+    // megabytes of data the child may allocate, applied by restarting it
+    void setMemoryLimit(unsigned memoryLimit);
+
+    // entry point of the child process
+    static const char workerArgument[];
+    static int execWorker(int argc, char *argv[]);
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> impl_;
+};
@@ -1,5 +1,8 @@
 #include "wavetable.h"
 #include <QFile>
+#include <QBuffer>
+#include <QByteArray>
+#include <zlib.h>
 #include <array>
 #include <type_traits>
 
@@ -32,6 +35,29 @@ static qint64 writeF32(QIODevice &stream, float x)
     return writeLE32(stream, u.i);
 }
 
+static quint32 readLE32(const char *p)
+{
+    const quint8 *b = reinterpret_cast<const quint8 *>(p);
+    return quint32(b[0]) | (quint32(b[1]) << 8) | (quint32(b[2]) << 16) | (quint32(b[3]) << 24);
+}
+static float readF32(const char *p)
+{
+    union { quint32 i; float f; } u;
+    u.i = readLE32(p);
+    return u.f;
+}
+
+Wavetable *Wavetables::allocate(unsigned count, unsigned frames)
+{
+    Wavetable_u wt(new Wavetable);
+    wt->count = count;
+    wt->frames = frames;
+    float *data = new float[count * frames];
+    wt->storage.reset(data, std::default_delete<float[]>());
+    wt->data = data;
+    return wt.release();
+}
+
 void Wavetables::saveToWAVFile(QFile &stream, const Wavetable &wt, const QString &code)
 {
     const unsigned sampleRate = 44100;
@@ -112,3 +138,57 @@ void Wavetables::saveToWAVFile(QFile &stream, const Wavetable &wt, const QString
     writeLE32(stream, riffEnd - riffStart);
     stream.flush();
 }
+
+QByteArray Wavetables::saveToCompressedData(const Wavetable &wt)
+{
+    QBuffer stream;
+    stream.open(QBuffer::WriteOnly);
+
+    writeLE32(stream, wt.count);
+    writeLE32(stream, wt.frames);
+    for (unsigned i = 0, n = wt.count * wt.frames; i < n; ++i)
+        writeF32(stream, wt.data[i]);
+
+    return qCompress(stream.data());
+}
+
+Wavetable *Wavetables::loadFromCompressedData(const QByteArray &data, unsigned maxCount, unsigned maxFrames)
+{
+    // the data is untrusted: inflate the stream of qCompress into a buffer
+    // of the size announced, bounded by the largest table, and reject the
+    // streams which overflow it
+    if (data.size() < 4)
+        return nullptr;
+    quint32 rawSize = (quint32(quint8(data[0])) << 24) | (quint32(quint8(data[1])) << 16) |
+        (quint32(quint8(data[2])) << 8) | quint32(quint8(data[3]));
+    if (rawSize < 8 || rawSize > 8 + 4 * quint64(maxCount) * maxFrames)
+        return nullptr;
+
+    QByteArray raw(int(rawSize), Qt::Uninitialized);
+    z_stream zs = {};
+    if (inflateInit(&zs) != Z_OK)
+        return nullptr;
+    zs.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data.constData() + 4));
+    zs.avail_in = uInt(data.size() - 4);
+    zs.next_out = reinterpret_cast<Bytef *>(raw.data());
+    zs.avail_out = uInt(raw.size());
+    int status = inflate(&zs, Z_FINISH);
+    inflateEnd(&zs);
+    if (status != Z_STREAM_END || zs.avail_out != 0)
+        return nullptr;
+
+    const char *p = raw.constData();
+    unsigned count = readLE32(p);
+    unsigned frames = readLE32(p + 4);
+    p += 8;
+
+    if (count < 1 || frames < 1 || count > maxCount || frames > maxFrames ||
+        quint64(raw.size() - 8) != 4 * quint64(count) * frames)
+        return nullptr;
+
+    Wavetable_u wt(allocate(count, frames));
+    for (unsigned i = 0, n = count * frames; i < n; ++i, p += 4)
+        wt->data[i] = readF32(p);
+
+    return wt.release();
+}
@@ -2,16 +2,21 @@
 #include <memory>
 class QFile;
 class QString;
+class QByteArray;
 
 struct Wavetable {
     unsigned count = 0; // number of subtables
     unsigned frames = 0; // number of frames per subtable
-    std::unique_ptr<float[]> data; // wave data [count * frames]
+    float *data = nullptr; // wave data [count * frames]
+    std::shared_ptr<void> storage; // owner of the wave data
 };
 
 typedef std::shared_ptr<Wavetable> Wavetable_s;
 typedef std::unique_ptr<Wavetable> Wavetable_u;
 
 namespace Wavetables {
+    Wavetable *allocate(unsigned count, unsigned frames);
     void saveToWAVFile(QFile &stream, const Wavetable &wt, const QString &code);
+    QByteArray saveToCompressedData(const Wavetable &wt);
+    Wavetable *loadFromCompressedData(const QByteArray &data, unsigned maxCount, unsigned maxFrames);
 }